@@ -5,6 +5,21 @@
  * Autor       : Aros D., Campaña B., Jurado Ordoñez Y., Palacios A.
  *****************************************************************************************************************************/
 
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "TROOT.h"
+#include "TSystem.h"
+#include "TMath.h"
+#include "TF1.h"
+#include "TList.h"
+#include "TGraphErrors.h"
+#include "TPolyMarker.h"
+#include "TCanvas.h"
+#include "TPad.h"
+#include "TLegend.h"
+
 using namespace std;
 using namespace TMath;
 
@@ -14,9 +29,12 @@ Double_t To = 74;                             // Temperatura agua [ºC].
 Double_t k  = 0.000764;                       // Constante de enfriamiento.
 
 // Constructores (sirven para inicializar un objeto y establecer sus propiedades y valores predeterminados).
-Double_t len_dif(Double_t x, Double_t y);
-Double_t rk4_solver(Double_t xo, Double_t yo, Double_t h, Double_t x, Double_t len_dif(Double_t xx, Double_t yy));
+Double_t len_dif(Double_t x, Double_t y, Double_t k);
+Double_t rk4_solver(Double_t xo, Double_t yo, Double_t h, Double_t x, Double_t k);
 Double_t fitFunc(Double_t* x, Double_t* par);
+TGraphErrors* prefit(TGraphErrors *gr, TF1 *f, Double_t cut = 3.5);
+Int_t fit_clean(TGraphErrors *gr, TF1 *f);
+TGraphErrors* stream_log(const char *fname, Int_t nmax = 256, Double_t dt = 0.1, Double_t sigma_t = 0.1, Double_t sigma_T = 1.);
 void CanvasPartition(TCanvas *C,const Int_t Nx,const Int_t Ny, Float_t lMargin, Float_t rMargin,Float_t bMargin, Float_t tMargin);
 
 // Función principal:
@@ -29,7 +47,7 @@ void gr2(){
     Double_t tiempo_plas_hab[10]      = {0., 61.012, 154.066, 271.057, 426.037, 635.080, 880.026, 1227.030, 1693.073, 2451.036};
     Double_t tiempo_plas_nev[10]      = {0., 49.046, 123.021, 214.028, 322.074, 591.064, 762.054, 981.024, 1241.062, 1541.059};
     Double_t tiempo_porc_hab[10]      = {0., 31.083, 105.037, 193.050, 325.006, 498.057, 734.031, 1040.016, 1478.095, 2105.031};
-    Double_t tiempo_porc_nev[10]      = {0., 60, 155.051, 268.006, 334.0.38, 470.024, 577.038, 768.061, 953.062, 1185.045};
+    Double_t tiempo_porc_nev[10]      = {0., 60, 155.051, 268.006, 334.038, 470.024, 577.038, 768.061, 953.062, 1185.045};
     Double_t tiempo_vidr_hab[10]      = {0., 55.041, 140.026, 253.067, 399.059, 582.015, 830.067, 1157.062, 1622.082, 2318.051};
     Double_t tiempo_vidr_nev[10]      = {0., 48.069, 116.010, 201.013, 299.082, 415.034, 545.016, 699.061, 896.004, 1145.097};
     Double_t temperatura_real[10]     = {74., 70., 65., 60., 55., 50., 45., 40., 35., 30.};
@@ -99,7 +117,7 @@ void gr2(){
     gr2->SetMarkerColor(kGreen+3);
     gr2->SetMarkerStyle(8);
     gr2->SetMarkerSize(1);
-	gr2->Fit("f1");
+	fit_clean(gr2, f1);
     gr2->Draw("p");    
     
     gr1->GetXaxis()->SetRangeUser(0,3000);
@@ -135,7 +153,7 @@ void gr2(){
     gr4->SetMarkerStyle(8);
     gr4->SetMarkerSize(1);
     gr4->Draw("p");
-	gr4->Fit("f1");
+	fit_clean(gr4, f1);
 	
     gr3->GetXaxis()->SetRangeUser(0,3000);
     //g3->GetYaxis()->SetRangeUser(0,2000);
@@ -169,7 +187,7 @@ void gr2(){
     gr6->SetMarkerStyle(8);
     gr6->SetMarkerSize(1);
     gr6->Draw("p");
-	gr6->Fit("f1");
+	fit_clean(gr6, f1);
 	
     gr5->GetXaxis()->SetRangeUser(0,3000);
     //gr5->GetYaxis()->SetRangeUser(0,2000);
@@ -178,12 +196,12 @@ void gr2(){
 	gr5->GetXaxis()->CenterTitle();
     gr5->GetYaxis()->CenterTitle();
     
-    TLegend* leg2 = new TLegend(0.5, 0.6, 0.85, 0.8);
-    leg2->SetBorderSize(0);
-    leg2->SetHeader("Agua-Vidrio");
-    leg2->AddEntry(gr5,"Datos Habitacion","pe");
-    leg2->AddEntry(gr6,"Datos Nevera","pe");
-    leg2->Draw();
+    TLegend* leg3 = new TLegend(0.5, 0.6, 0.85, 0.8);
+    leg3->SetBorderSize(0);
+    leg3->SetHeader("Agua-Vidrio");
+    leg3->AddEntry(gr5,"Datos Habitacion","pe");
+    leg3->AddEntry(gr6,"Datos Nevera","pe");
+    leg3->Draw();
 
     	
     ////////////////////////////////////////////////////////////
@@ -228,23 +246,25 @@ void gr2(){
 
 ///////////////////////////////////////////   Funciones para el ajuste   ///////////////////////////////////////////
 
-Double_t len_dif(Double_t x, Double_t y){
+Double_t len_dif(Double_t x, Double_t y, Double_t k){
     return -k * (y - Ta);
 }
 
 
-Double_t rk4_solver(Double_t xo, Double_t yo, Double_t h, Double_t x){
+Double_t rk4_solver(Double_t xo, Double_t yo, Double_t h, Double_t x, Double_t k){
     Int_t n = (x - xo)/h;
-    Double_t y = yo;
-		for (Int_t i = 0; i<n; i++) {
-            Double_t k1 = h*len_dif(xo, y);
-            Double_t k2 = h*len_dif(xo + 0.5*h, y + 0.5*k1);
-            Double_t k3 = h*len_dif(xo + 0.5*h, y + 0.5*k2);
-            Double_t k4 = h*len_dif(xo + h, y + k3);
-            y += (k1 + 2.*k2 + 2.*k3 + k4)/6.;
-            xo += h;
-        }
-    return y;
+    if (n <= 0) return yo;
+    
+    // len_dif es lineal en y y no depende de x: cada paso de RK4 multiplica (y - Ta) por el mismo factor g,
+    // así que los n pasos se reducen a g^n y el coste de fitFunc no crece con el tiempo t.
+    Double_t u  = 1.;
+    Double_t k1 = h*len_dif(xo, Ta + u, k);
+    Double_t k2 = h*len_dif(xo + 0.5*h, Ta + u + 0.5*k1, k);
+    Double_t k3 = h*len_dif(xo + 0.5*h, Ta + u + 0.5*k2, k);
+    Double_t k4 = h*len_dif(xo + h, Ta + u + k3, k);
+    Double_t g  = u + (k1 + 2.*k2 + 2.*k3 + k4)/6.;
+    
+    return Ta + (yo - Ta)*Power(g, n);
 }	
 
 Double_t fitFunc(Double_t* x, Double_t* par){
@@ -252,11 +272,259 @@ Double_t fitFunc(Double_t* x, Double_t* par){
     Double_t k = par[1];
 
     Double_t t = x[0];
-    Double_t y = rk4_solver(0, To, 0.1, t); // Calculamos el valor de y con Runge-Kutta
+    Double_t y = rk4_solver(0, To, 0.1, t, k); // Calculamos el valor de y con Runge-Kutta
 
     return y;
 }
 
+// Pre-ajuste rápido: regresión lineal cerrada de ln[(T-Ta)/(To-Ta)] = a - k t, ponderada con w = [(T-Ta)/sigma_T]^2.
+// Marca los puntos inválidos (T <= Ta, t < 0) y los atípicos (|residuo - mediana| > cut*max(MAD, 1)) con una X sobre gr, sin
+// borrarlos, y siembra To y k en f. Devuelve una copia de gr sin los puntos marcados, que es la que se ajusta.
+TGraphErrors* prefit(TGraphErrors *gr, TF1 *f, Double_t cut){
+    Int_t n = gr->GetN();
+    Double_t *x  = gr->GetX();
+    Double_t *y  = gr->GetY();
+    Double_t *ex = gr->GetEX();
+    Double_t *ey = gr->GetEY();
+    
+    vector<Double_t> ly(n), w(n), r(n), dr(n), pull(n, 0.);
+    vector<Bool_t> ok(n);
+    
+    for (Int_t i=0; i<n; i++) {
+        ok[i] = (y[i] - Ta > 0.) && (x[i] >= 0.) && Finite(x[i]) && Finite(y[i]);
+        if (!ok[i]) continue;
+        Double_t s = (ey[i] > 0.) ? ey[i] : 1.;
+        ly[i] = Log((y[i] - Ta)/(To - Ta));
+        w[i]  = (y[i] - Ta)*(y[i] - Ta)/(s*s);
+    }
+    
+    Double_t a = 0., b = 0., med = 0., mad = 0.;
+    Bool_t seed = kTRUE;
+    for (Int_t pass=0; pass<2; pass++) {
+        Double_t S = 0., Sx = 0., Sy = 0., Sxx = 0., Sxy = 0.;
+        Int_t m = 0;
+        for (Int_t i=0; i<n; i++) {
+            if (!ok[i]) continue;
+            S   += w[i];
+            Sx  += w[i]*x[i];
+            Sy  += w[i]*ly[i];
+            Sxx += w[i]*x[i]*x[i];
+            Sxy += w[i]*x[i]*ly[i];
+            m++;
+        }
+        Double_t det = S*Sxx - Sx*Sx;
+        if (m < 3 || det <= 0.) {
+            printf("prefit: %s sin puntos suficientes (%d validos), ajuste sin sembrar.\n", gr->GetName(), m);
+            seed = kFALSE;
+            break;
+        }
+        a = (Sxx*Sy - Sx*Sxy)/det;
+        b = (S*Sxy - Sx*Sy)/det;
+        if (pass == 1) break;
+        
+        // Residuos normalizados (en unidades de sigma_T) y escala robusta (MAD). La escala nunca baja de 1: en datos
+        // limpios la MAD es mucho menor que 1 y un punto dentro de su barra de error no es atípico.
+        m = 0;
+        for (Int_t i=0; i<n; i++) if (ok[i]) r[m++] = pull[i] = (ly[i] - a - b*x[i])*Sqrt(w[i]);
+        med = Median(m, r.data());
+        for (Int_t i=0; i<m; i++) dr[i] = Abs(r[i] - med);
+        mad = 1.4826*Median(m, dr.data());
+        
+        for (Int_t i=0; i<n; i++) {
+            if (ok[i] && Abs(pull[i] - med) > cut*Max(mad, 1.)) ok[i] = kFALSE;
+        }
+    }
+    
+    TGraphErrors *grf = new TGraphErrors();
+    grf->SetName(Form("%s_fit", gr->GetName()));
+    TPolyMarker *pm = 0;
+    
+    for (Int_t i=0; i<n; i++) {
+        if (ok[i]) {
+            Int_t ip = grf->GetN();
+            grf->SetPoint(ip, x[i], y[i]);
+            grf->SetPointError(ip, ex[i], ey[i]);
+            continue;
+        }
+        if (y[i] - Ta > 0. && x[i] >= 0. && Finite(x[i]) && Finite(y[i])) {
+            printf("prefit: %s excluye del ajuste el punto %d (t = %g s, T = %g C): |residuo - mediana| = %.2f > %g*max(MAD = %.3f, 1).\n",
+                   gr->GetName(), i, x[i], y[i], Abs(pull[i] - med), cut, mad);
+        } else {
+            printf("prefit: %s excluye del ajuste el punto %d (t = %g s, T = %g C): punto invalido (T <= Ta o t < 0).\n",
+                   gr->GetName(), i, x[i], y[i]);
+        }
+        if (!pm) {
+            pm = new TPolyMarker();
+            pm->SetMarkerStyle(5);
+            pm->SetMarkerSize(2);
+            pm->SetMarkerColor(kBlack);
+            gr->GetListOfFunctions()->Add(pm);
+        }
+        pm->SetNextPoint(x[i], y[i]);
+    }
+    
+    if (seed) f->SetParameters(Ta + (To - Ta)*Exp(a), -b);
+    return grf;
+}
+
+// Ajusta f solo a los puntos que acepta prefit. El TF1 ajustado se guarda en gr (gr->GetFunction) y se dibuja con él.
+Int_t fit_clean(TGraphErrors *gr, TF1 *f){
+    TGraphErrors *grf = prefit(gr, f);
+    Int_t status = grf->Fit(f);
+    
+    TF1 *ff = grf->GetFunction(f->GetName());
+    if (ff) {
+        grf->GetListOfFunctions()->Remove(ff);
+        gr->GetListOfFunctions()->Add(ff);
+    }
+    delete grf;
+    return status;
+}
+
+
+////////////////////////////////////////////    Modo streaming    ////////////////////////////////////////////////
+// Buffer de tamaño fijo para registros largos (p.ej. 10 Hz durante horas). Las muestras se agrupan en nmax bins uniformes
+// en u = ln[1 + (t - to)/tau], con tau = nmax*dt: los bins miden ~dt al principio, donde la curva cambia rápido, y se
+// ensanchan con t, donde es casi plana. Cuando el registro supera los nmax bins se fusionan por pares y du se duplica.
+// Cada muestra se decide por separado: se acepta si no salta más de fsalto*(tramo registrado + tau) tras la última
+// aceptada; si no, queda pendiente y solo se acepta (como reanudación tras una pausa) si la siguen nconf muestras
+// consistentes. Así una línea corrupta, aunque sea la primera, no fija el origen ni bloquea el resto del registro.
+struct StreamBuffer {
+    static const Int_t nconf = 5;              // Muestras consistentes para confirmar un inicio o una pausa.
+    Int_t    nmax;                             // Número máximo de bins en memoria (par).
+    Double_t tau;                              // Escala de la compresión logarítmica del tiempo [s].
+    Double_t du;                               // Ancho actual de los bins en u.
+    Double_t fsalto;                           // Salto máximo admitido, en unidades del tramo registrado.
+    Double_t to;                               // Tiempo de inicio del registro [s].
+    Double_t tlast;                            // Mayor tiempo aceptado [s].
+    Long64_t nsamp;                            // Número de muestras aceptadas.
+    Long64_t nnofin, nantes, nsalto;           // Rechazadas: no finitas, anteriores al inicio, saltos sin confirmar.
+    Int_t    npausa;                           // Número de pausas superadas.
+    Int_t    nimp;                             // Número de rechazos ya impresos.
+    Int_t    npend;                            // Muestras pendientes de confirmar.
+    Double_t pt[nconf], pT[nconf];             // Muestras pendientes (t, T).
+    vector<Double_t> n, st, sT;                // Por bin: número de muestras, suma de tiempos, suma de temperaturas.
+    
+    StreamBuffer(Int_t nm, Double_t dt) : nmax(nm < 2 ? 2 : (nm > (1<<20) ? (1<<20) : nm - nm%2)), fsalto(4.), to(0.),
+                                          tlast(0.), nsamp(0), nnofin(0), nantes(0), nsalto(0), npausa(0), nimp(0), npend(0),
+                                          n(nmax, 0.), st(nmax, 0.), sT(nmax, 0.) {
+        tau = nmax*dt;
+        du  = Log(1. + 1./nmax);               // El primer bin mide dt.
+    }
+    
+    void Reject(Double_t t, Double_t T, Long64_t &cnt, const char *motivo){
+        cnt++;
+        if (nimp++ < 10) printf("StreamBuffer: descarta la muestra t = %g s, T = %g C (%s).\n", t, T, motivo);
+    }
+    
+    void Add(Double_t t, Double_t T){
+        // u <= ln(DBL_MAX) ~ 710 y du >= ln(1 + 1/nmax), así que el índice nunca desborda.
+        Double_t u = Log(1. + (t - to)/tau);
+        Long64_t i = (Long64_t) (u/du);
+        while (i >= nmax) {
+            for (Int_t j=0; j<nmax/2; j++) {
+                n[j]  = n[2*j]  + n[2*j+1];
+                st[j] = st[2*j] + st[2*j+1];
+                sT[j] = sT[2*j] + sT[2*j+1];
+            }
+            for (Int_t j=nmax/2; j<nmax; j++) n[j] = st[j] = sT[j] = 0.;
+            du *= 2.;
+            i /= 2;
+        }
+        n[i]  += 1.;
+        st[i] += t;
+        sT[i] += T;
+        if (t > tlast) tlast = t;
+        nsamp++;
+    }
+    
+    // Acepta las muestras pendientes (inicio del registro o reanudación tras una pausa).
+    void Confirm(){
+        if (nsamp == 0) {
+            to = tlast = pt[0];
+        } else {
+            npausa++;
+            printf("StreamBuffer: pausa de %g s en t = %g s, el registro se reanuda.\n", pt[0] - tlast, tlast);
+        }
+        for (Int_t j=0; j<npend; j++) Add(pt[j], pT[j]);
+        npend = 0;
+    }
+    
+    void Fill(Double_t t, Double_t T){
+        if (!Finite(t) || !Finite(T)) { Reject(t, T, nnofin, "no finita"); return; }
+        if (nsamp > 0 && t < to)      { Reject(t, T, nantes, "anterior al inicio del registro"); return; }
+        
+        if (nsamp > 0 && t - tlast <= fsalto*(tlast - to + tau)) {
+            for (Int_t j=0; j<npend; j++) Reject(pt[j], pT[j], nsalto, "salto aislado");
+            npend = 0;
+            Add(t, T);
+            return;
+        }
+        
+        if (npend > 0 && !(t >= pt[npend-1] && t - pt[npend-1] <= fsalto*(pt[npend-1] - pt[0] + tau))) {
+            for (Int_t j=0; j<npend; j++) Reject(pt[j], pT[j], nsalto, "salto aislado");
+            npend = 0;
+        }
+        pt[npend] = t;
+        pT[npend] = T;
+        if (++npend == nconf) Confirm();
+    }
+    
+    // Al final del registro: si aún no había empezado se aceptan las pendientes, si no se descartan.
+    void Flush(){
+        if (npend == 0) return;
+        if (nsamp == 0) {
+            Confirm();
+            return;
+        }
+        for (Int_t j=0; j<npend; j++) Reject(pt[j], pT[j], nsalto, "salto sin confirmar al final");
+        npend = 0;
+    }
+    
+    // Cada bin se sustituye por su media, con errores sigma/sqrt(n): equivale a las n muestras en el chi2 del ajuste.
+    // Los bins logarítmicos mantienen pequeño el sesgo por la curvatura dentro de cada bin.
+    TGraphErrors* Graph(Double_t sigma_t, Double_t sigma_T){
+        TGraphErrors *gr = new TGraphErrors();
+        for (Int_t j=0; j<nmax; j++) {
+            if (n[j] <= 0.) continue;
+            Int_t ip = gr->GetN();
+            gr->SetPoint(ip, st[j]/n[j], sT[j]/n[j]);
+            gr->SetPointError(ip, sigma_t/Sqrt(n[j]), sigma_T/Sqrt(n[j]));
+        }
+        return gr;
+    }
+};
+
+// Lee un registro "t T" (una muestra por línea) sin guardarlo en memoria y devuelve a lo sumo nmax puntos ponderados.
+// dt es el ancho de los primeros bins, del orden del intervalo de muestreo.
+// Uso: TGraphErrors *g = stream_log("log.txt"); fit_clean(g, f1);
+TGraphErrors* stream_log(const char *fname, Int_t nmax, Double_t dt, Double_t sigma_t, Double_t sigma_T){
+    if (!(dt > 0.) || !Finite(dt) || nmax < 2 || nmax > (1<<20)) {
+        printf("stream_log: parametros invalidos (nmax = %d debe estar en [2, 2^20], dt = %g debe ser > 0).\n", nmax, dt);
+        return 0;
+    }
+    ifstream in(fname);
+    if (!in) {
+        printf("stream_log: no se puede abrir %s.\n", fname);
+        return 0;
+    }
+    
+    StreamBuffer buf(nmax, dt);
+    Double_t t, T;
+    string line;
+    while (getline(in, line)) {
+        if (line.empty() || line[0] == '#') continue;
+        if (sscanf(line.c_str(), "%lf %lf", &t, &T) == 2) buf.Fill(t, T);
+    }
+    buf.Flush();
+    
+    TGraphErrors *gr = buf.Graph(sigma_t, sigma_T);
+    gr->SetName(gSystem->BaseName(fname));
+    printf("stream_log: %s, %lld muestras -> %d puntos, %d pausas; descartadas: %lld no finitas, %lld anteriores al inicio, "
+           "%lld saltos aislados.\n", fname, buf.nsamp, gr->GetN(), buf.npausa, buf.nnofin, buf.nantes, buf.nsalto);
+    return gr;
+}
+
 
 ////////////////////////////////////////////    Divición del canvas    //////////////////////////////////////////
 void CanvasPartition(TCanvas *C,const Int_t Nx,const Int_t Ny, Float_t lMargin, Float_t rMargin,Float_t bMargin, Float_t tMargin){